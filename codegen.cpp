@@ -5,121 +5,213 @@
 #include "llvm/IR/Value.h"
 #include <iostream>
 #include <llvm/IR/Instructions.h>
-#include <llvm/IRPrinter/IRPrintingPasses.h>
 
 using namespace std;
 
 /* Compile the AST into a module */
-void CodeGenContext::generateCode(NBlock &root, std::string bcFile) {
-  std::cout << "Generating code...\n";
+void CodeGenContext::generateCode(NBlock &root) {
+  trace() << "Generating code...\n";
 
   /* Create the top level interpreter function to call as entry */
   vector<Type *> argTypes;
   FunctionType *ftype =
-      FunctionType::get(Type::getInt32Ty(MyContext), argTypes, false);
-  mainFunction =
-      Function::Create(ftype, GlobalValue::ExternalLinkage, "main", module);
-
-  std::cout << "name2: " << mainFunction->getName().str() << endl;
-  BasicBlock *bblock = BasicBlock::Create(MyContext, "entry", mainFunction, 0);
+      FunctionType::get(Type::getInt32Ty(getContext()), argTypes, false);
+  mainFunction = Function::Create(ftype,
+                                  library ? GlobalValue::InternalLinkage
+                                          : GlobalValue::ExternalLinkage,
+                                  "main", module);
+
+  trace() << "name2: " << mainFunction->getName().str() << "\n";
+  BasicBlock *bblock =
+      BasicBlock::Create(getContext(), "entry", mainFunction, 0);
   Builder->SetInsertPoint(bblock);
 
   /* Push a new variable/block context */
   pushBlock(bblock);
+  if (DBuilder) setDebugScope(createDebugFunction(mainFunction, 1));
   root.codeGen(*this); /* emit bytecode for the toplevel block */
 
-  Builder->CreateRet(ConstantInt::get(Type::getInt32Ty(MyContext), 0));
+  Builder->CreateRet(ConstantInt::get(Type::getInt32Ty(getContext()), 0));
   popBlock();
 
-  std::cout << "Code is generated.\n";
-  printIR(module);
+  if (DBuilder) DBuilder->finalize();
+
+  trace() << "Code is generated.\n";
 }
 
-/* Executes the AST by running the main function */
-GenericValue CodeGenContext::runCode() {
-  std::cout << "Running code...\n";
-  ExecutionEngine *ee = EngineBuilder(unique_ptr<Module>(module)).create();
-  ee->finalizeObject();
-  vector<GenericValue> noargs;
-  GenericValue v = ee->runFunction(mainFunction, noargs);
-  std::cout << "Code was run.\n";
-  return v;
+void CodeGenContext::emitDebugInfo(StringRef filename, StringRef directory) {
+  module->addModuleFlag(Module::Warning, "Debug Info Version",
+                        DEBUG_METADATA_VERSION);
+  module->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+  module->setSourceFileName(filename);
+
+  DBuilder = std::make_unique<DIBuilder>(*module);
+  compileUnit = DBuilder->createCompileUnit(
+      dwarf::DW_LANG_C, DBuilder->createFile(filename, directory),
+      "toy compiler", false, "", 0);
 }
 
-/* Returns an LLVM type based on the identifier */
-static Type *typeOf(const NIdentifier &type) {
-  if (type.name.compare("int") == 0) {
-    return Type::getInt64Ty(MyContext);
-  } else if (type.name.compare("double") == 0) {
-    return Type::getDoubleTy(MyContext);
+/* Returns the debug type of an LLVM type, null for void */
+static DIType *debugTypeOf(CodeGenContext &context, Type *type) {
+  if (type->isIntegerTy())
+    return context.DBuilder->createBasicType(
+        "int", type->getIntegerBitWidth(), dwarf::DW_ATE_signed);
+  if (type->isDoubleTy())
+    return context.DBuilder->createBasicType("double", 64,
+                                             dwarf::DW_ATE_float);
+  return nullptr;
+}
+
+DISubprogram *CodeGenContext::createDebugFunction(Function *function,
+                                                  int line) {
+  /* The first element is the return type */
+  SmallVector<Metadata *, 8> types;
+  types.push_back(debugTypeOf(*this, function->getReturnType()));
+  for (auto &arg : function->args())
+    types.push_back(debugTypeOf(*this, arg.getType()));
+
+  DIFile *file = compileUnit->getFile();
+  DISubprogram *subprogram = DBuilder->createFunction(
+      file, function->getName(), StringRef(), file, line,
+      DBuilder->createSubroutineType(DBuilder->getOrCreateTypeArray(types)),
+      line, DINode::FlagPrototyped, DISubprogram::SPFlagDefinition);
+  function->setSubprogram(subprogram);
+  return subprogram;
+}
+
+void CodeGenContext::emitLocation(const Node &node) {
+  DIScope *scope = blocks.top()->debugScope;
+  if (!scope) return;
+  Builder->SetCurrentDebugLocation(
+      DILocation::get(getContext(), node.line, node.column, scope));
+}
+
+Value *CodeGenContext::createProfileSite(StringRef name) {
+  /* struct ProfileSite of profiler.cpp, the runtime sets the id on the
+     first entry and finds the counters of the site by it */
+  Type *idType = Type::getInt32Ty(getContext());
+  Constant *siteName = Builder->CreateGlobalStringPtr(name, ".prof.name");
+  StructType *siteType =
+      StructType::get(getContext(), {siteName->getType(), idType});
+  return new GlobalVariable(
+      *module, siteType, false, GlobalValue::PrivateLinkage,
+      ConstantStruct::get(siteType, {siteName, ConstantInt::get(idType, 0)}),
+      ".prof");
+}
+
+void CodeGenContext::emitProfileCall(StringRef hook, Value *site,
+                                     Value *trips) {
+  std::vector<Type *> argTypes{site->getType()};
+  std::vector<Value *> args{site};
+  if (trips) {
+    argTypes.push_back(Type::getInt64Ty(getContext()));
+    args.push_back(trips);
   }
-  return Type::getVoidTy(MyContext);
+  FunctionCallee callee = module->getOrInsertFunction(
+      hook, FunctionType::get(Type::getVoidTy(getContext()), argTypes, false));
+  Builder->CreateCall(callee, args);
+}
+
+/* Returns an LLVM type based on the interface type */
+static Type *typeOf(CodeGenContext &context, InterfaceType type) {
+  switch (type) {
+    case InterfaceType::Int:
+      return Type::getInt64Ty(context.getContext());
+    case InterfaceType::Double:
+      return Type::getDoubleTy(context.getContext());
+    case InterfaceType::Void:
+      break;
+  }
+  return Type::getVoidTy(context.getContext());
+}
+
+/* Returns an LLVM type based on the identifier */
+static Type *typeOf(CodeGenContext &context, const NIdentifier &type) {
+  return typeOf(context, interfaceTypeOf(type.name));
 }
 
 /* -- Code Generation -- */
 
 Value *NInteger::codeGen(CodeGenContext &context) {
-  std::cout << "Creating integer: " << value << endl;
-  return ConstantInt::get(Type::getInt64Ty(MyContext), value, true);
+  context.trace() << "Creating integer: " << value << "\n";
+  return ConstantInt::get(Type::getInt64Ty(context.getContext()), value, true);
 }
 
 Value *NDouble::codeGen(CodeGenContext &context) {
-  std::cout << "Creating double: " << value << endl;
-  return ConstantFP::get(Type::getDoubleTy(MyContext), value);
+  context.trace() << "Creating double: " << value << "\n";
+  return ConstantFP::get(Type::getDoubleTy(context.getContext()), value);
 }
 
 Value *NIdentifier::codeGen(CodeGenContext &context) {
-  std::cout << "Creating identifier reference: " << name << endl;
+  context.trace() << "Creating identifier reference: " << name << "\n";
   if (context.locals().find(name) == context.locals().end()) {
-    std::cerr << "undeclared variable " << name << endl;
+    context.error("undeclared variable " + name);
     return NULL;
   }
-  return context.Builder->CreateLoad(llvm::Type::getInt64Ty(MyContext),
-                                     context.locals()[name], "");
+  return context.Builder->CreateLoad(
+      llvm::Type::getInt64Ty(context.getContext()), context.locals()[name], "");
 }
 
 Value *NMethodCall::codeGen(CodeGenContext &context) {
   Function *function = context.module->getFunction(id.name.c_str());
-  if (function == NULL) { std::cerr << "no such function " << id.name << endl; }
+  if (function == NULL) {
+    context.error("no such function " + id.name);
+    return NULL;
+  }
+  if (arguments.size() != function->arg_size()) {
+    context.error("wrong number of arguments to " + id.name);
+    return NULL;
+  }
   std::vector<Value *> args;
   ExpressionList::const_iterator it;
   for (it = arguments.begin(); it != arguments.end(); it++) {
-    args.push_back((**it).codeGen(context));
+    Value *arg = (**it).codeGen(context);
+    if (!arg) return NULL;
+    if (arg->getType() != function->getArg(args.size())->getType()) {
+      context.error("wrong type of argument " + std::to_string(args.size() + 1) +
+                    " to " + id.name);
+      return NULL;
+    }
+    args.push_back(arg);
   }
   auto call = context.Builder->CreateCall(function, args, "");
-  std::cout << "Creating method call: " << id.name << endl;
+  context.trace() << "Creating method call: " << id.name << "\n";
   return call;
 }
 
 Value *NBinaryOperator::codeGen(CodeGenContext &context) {
-  std::cout << "Creating binary operation " << op << endl;
-  Instruction::BinaryOps instr;
+  context.trace() << "Creating binary operation " << op << "\n";
+  Value *L = lhs.codeGen(context);
+  Value *R = rhs.codeGen(context);
+  if (!L || !R) return NULL;
+  if (L->getType() != R->getType() || !L->getType()->isIntegerTy()) {
+    context.error("operands of a binary operation must both be int");
+    return NULL;
+  }
   switch (op) {
     case TPLUS:
-      return context.Builder->CreateAdd(lhs.codeGen(context),
-                                        rhs.codeGen(context), "addtmp");
+      return context.Builder->CreateAdd(L, R, "addtmp");
     case TMINUS:
-      return context.Builder->CreateSub(lhs.codeGen(context),
-                                        rhs.codeGen(context), "subtmp");
+      return context.Builder->CreateSub(L, R, "subtmp");
     case TMUL:
-      return context.Builder->CreateMul(lhs.codeGen(context),
-                                        rhs.codeGen(context), "multmp");
+      return context.Builder->CreateMul(L, R, "multmp");
     case TDIV:
-      return context.Builder->CreateSDiv(lhs.codeGen(context),
-                                         rhs.codeGen(context), "idivtmp");
+      return context.Builder->CreateSDiv(L, R, "idivtmp");
       /* TODO comparison */
   }
+  context.error("unsupported binary operator");
   return nullptr;
 }
 
 Value *NAssignment::codeGen(CodeGenContext &context) {
-  std::cout << "Creating assignment for " << lhs.name << endl;
+  context.trace() << "Creating assignment for " << lhs.name << "\n";
   if (context.locals().find(lhs.name) == context.locals().end()) {
-    std::cerr << "undeclared variable " << lhs.name << endl;
+    context.error("undeclared variable " + lhs.name);
     return NULL;
   }
-  return context.Builder->CreateStore(rhs.codeGen(context),
-                                      context.locals()[lhs.name]);
+  Value *value = rhs.codeGen(context);
+  if (!value) return NULL;
+  return context.Builder->CreateStore(value, context.locals()[lhs.name]);
 }
 
 Value *NBlock::codeGen(CodeGenContext &context) {
@@ -127,31 +219,36 @@ Value *NBlock::codeGen(CodeGenContext &context) {
   Value *last = NULL;
   for (it = statements.begin(); it != statements.end(); it++) {
     auto &statement = **it;
-    std::cout << "Generating code for " << typeid(statement).name() << endl;
+    context.trace() << "Generating code for " << typeid(statement).name()
+                    << "\n";
+    context.emitLocation(statement);
     last = (statement).codeGen(context);
+    /* Statements may yield no value, errors are told by the diagnostics */
+    if (!context.diagnostics.empty()) return NULL;
   }
-  std::cout << "Creating block" << endl;
+  context.trace() << "Creating block\n";
   return last;
 }
 
 Value *NExpressionStatement::codeGen(CodeGenContext &context) {
-  std::cout << "Generating code for " << typeid(expression).name() << endl;
+  context.trace() << "Generating code for " << typeid(expression).name()
+                  << "\n";
   return expression.codeGen(context);
 }
 
 Value *NReturnStatement::codeGen(CodeGenContext &context) {
-  std::cout << "Generating return code for " << typeid(expression).name()
-            << endl;
+  context.trace() << "Generating return code for "
+                  << typeid(expression).name() << "\n";
   Value *returnValue = expression.codeGen(context);
   context.setCurrentReturnValue(returnValue);
   return returnValue;
 }
 
 Value *NVariableDeclaration::codeGen(CodeGenContext &context) {
-  std::cout << "Creating variable declaration " << type.name << " " << id.name
-            << endl;
-  auto alloc =
-      context.Builder->CreateAlloca(typeOf(type), nullptr, id.name.c_str());
+  context.trace() << "Creating variable declaration " << type.name << " "
+                  << id.name << "\n";
+  auto alloc = context.Builder->CreateAlloca(typeOf(context, type), nullptr,
+                                             id.name.c_str());
   context.locals()[id.name] = alloc;
   if (assignmentExpr != NULL) {
     NAssignment assn(id, *assignmentExpr);
@@ -164,29 +261,58 @@ Value *NExternDeclaration::codeGen(CodeGenContext &context) {
   vector<Type *> argTypes;
   VariableList::const_iterator it;
   for (it = arguments.begin(); it != arguments.end(); it++) {
-    argTypes.push_back(typeOf((**it).type));
+    argTypes.push_back(typeOf(context, (**it).type));
+  }
+  FunctionType *ftype =
+      FunctionType::get(typeOf(context, type), argTypes, false);
+  /* Repeating a declaration is fine, a different one would be renamed */
+  if (Function *existing = context.module->getFunction(id.name)) {
+    if (existing->getFunctionType() != ftype) {
+      context.error("conflicting declaration of function " + id.name);
+      return NULL;
+    }
+    return existing;
   }
-  FunctionType *ftype = FunctionType::get(typeOf(type), argTypes, false);
   Function *function = Function::Create(ftype, GlobalValue::ExternalLinkage,
                                         id.name.c_str(), context.module);
   return function;
 }
 
 Value *NFunctionDeclaration::codeGen(CodeGenContext &context) {
+  /* LLVM would rename the definition and calls would bind to the other one */
+  if (context.module->getFunction(id.name)) {
+    context.error("redefinition of function " + id.name);
+    return NULL;
+  }
   vector<Type *> argTypes;
   VariableList::const_iterator it;
   for (it = arguments.begin(); it != arguments.end(); it++)
-    argTypes.push_back(typeOf((**it).type));
+    argTypes.push_back(typeOf(context, (**it).type));
 
-  FunctionType *ftype = FunctionType::get(typeOf(type), argTypes, false);
-  Function *function = Function::Create(ftype, GlobalValue::InternalLinkage,
-                                        id.name.c_str(), context.module);
-  std::cout << "name: " << id.name << endl;
-  BasicBlock *bblock = BasicBlock::Create(MyContext, "entry", function, 0);
+  FunctionType *ftype =
+      FunctionType::get(typeOf(context, type), argTypes, false);
+  Function *function = Function::Create(
+      ftype,
+      exported ? GlobalValue::ExternalLinkage : GlobalValue::InternalLinkage,
+      id.name.c_str(), context.module);
+  context.trace() << "name: " << id.name << "\n";
+
+  if (exported) {
+    FunctionSignature signature{id.name, interfaceTypeOf(type.name), {}};
+    for (auto arg : arguments)
+      signature.ArgTypes.push_back(interfaceTypeOf(arg->type.name));
+    context.exports.push_back(signature);
+  }
+  BasicBlock *bblock =
+      BasicBlock::Create(context.getContext(), "entry", function, 0);
   auto PreInsertBB = context.Builder->GetInsertBlock();
+  auto PreDebugLoc = context.Builder->getCurrentDebugLocation();
   context.Builder->SetInsertPoint(bblock);
 
   context.pushBlock(bblock);
+  if (context.DBuilder)
+    context.setDebugScope(context.createDebugFunction(function, line));
+  context.emitLocation(*this);
 
   Function::arg_iterator argsValues = function->arg_begin();
   Value *argumentValue;
@@ -200,18 +326,66 @@ Value *NFunctionDeclaration::codeGen(CodeGenContext &context) {
         argumentValue, context.locals()[(*it)->id.name]);
   }
 
+  Value *ProfileSite = nullptr;
+  if (context.profile) {
+    ProfileSite = context.createProfileSite(
+        context.module->getName().str() + ":" + id.name);
+    context.emitProfileCall("__toy_profile_enter", ProfileSite);
+  }
+
   block.codeGen(context);
 
+  if (ProfileSite) context.emitProfileCall("__toy_profile_exit", ProfileSite);
+
   context.Builder->CreateRet(context.getCurrentReturnValue());
 
   context.popBlock();
-  std::cout << "Creating function: " << id.name << endl;
+  context.trace() << "Creating function: " << id.name << "\n";
 
   context.Builder->SetInsertPoint(PreInsertBB);
+  context.Builder->SetCurrentDebugLocation(PreDebugLoc);
 
   return function;
 }
 
+Value *NImportStatement::codeGen(CodeGenContext &context) {
+  context.trace() << "Importing module " << module.name << "\n";
+  std::unique_ptr<MemoryBuffer> interface;
+  if (context.importResolver) interface = context.importResolver(module.name);
+  if (!interface) {
+    context.error("cannot find module " + module.name);
+    return NULL;
+  }
+
+  std::vector<FunctionSignature> functions;
+  std::string error;
+  if (!readInterface(interface->getBuffer(), functions, error)) {
+    context.error("bad interface of module " + module.name + ": " + error);
+    return NULL;
+  }
+
+  /* Declare the imported functions, like an extern declaration would */
+  for (auto &signature : functions) {
+    vector<Type *> argTypes;
+    for (auto argType : signature.ArgTypes)
+      argTypes.push_back(typeOf(context, argType));
+    FunctionType *ftype = FunctionType::get(
+        typeOf(context, signature.ReturnType), argTypes, false);
+
+    /* Declaring the same function twice is fine, a different one or one
+       defined here, like echo, isn't */
+    if (Function *existing = context.module->getFunction(signature.Name)) {
+      if (existing->getFunctionType() != ftype || !existing->isDeclaration())
+        context.error("imported function " + signature.Name + " of module " +
+                      module.name + " conflicts with an existing declaration");
+      continue;
+    }
+    Function::Create(ftype, GlobalValue::ExternalLinkage, signature.Name,
+                     context.module);
+  }
+  return NULL;
+}
+
 void NBranchStatement::setIFBlocks(IFBlockList &ifBlocks) {
   IFBlocks = ifBlocks;
 }
@@ -221,7 +395,7 @@ void NBranchStatement::setElseBlock(NBlock *block) {
 }
 
 Value *NBranchStatement::codeGen(CodeGenContext &context) {
-  std::cout << "Creating branch" << endl;
+  context.trace() << "Creating branch\n";
   IFBlockList::const_iterator it;
   Value *CondV;
   BasicBlock *PreInsertBB = context.Builder->GetInsertBlock();
@@ -232,12 +406,12 @@ Value *NBranchStatement::codeGen(CodeGenContext &context) {
   std::vector<BasicBlock *> ThenBBs;
   auto Parent = TheFunction;
   for (auto &IFBlock : IFBlocks) {
-    IfBBs.push_back(BasicBlock::Create(MyContext, "if"));
-    ThenBBs.push_back(BasicBlock::Create(MyContext, "then"));
+    IfBBs.push_back(BasicBlock::Create(context.getContext(), "if"));
+    ThenBBs.push_back(BasicBlock::Create(context.getContext(), "then"));
   }
 
-  BasicBlock *ElseBB = BasicBlock::Create(MyContext, "else");
-  BasicBlock *MergeBB = BasicBlock::Create(MyContext, "merge");
+  BasicBlock *ElseBB = BasicBlock::Create(context.getContext(), "else");
+  BasicBlock *MergeBB = BasicBlock::Create(context.getContext(), "merge");
 
   for (int i = 0; i < IFBlocks.size(); i++) {
     NIFBlock *IFBlock = dynamic_cast<NIFBlock *>(IFBlocks[i]);
@@ -265,15 +439,17 @@ Value *NBranchStatement::codeGen(CodeGenContext &context) {
 
 
     CondV = context.Builder->CreateICmpEQ(
-        CondV, ConstantInt::get(Type::getInt64Ty(MyContext), 0), "ifcond");
+        CondV, ConstantInt::get(Type::getInt64Ty(context.getContext()), 0),
+        "ifcond");
 
     context.Builder->CreateCondBr(CondV, ElseIfBB, ThenBB);
 
     TheFunction->insert(TheFunction->end(), ThenBB);
     context.Builder->SetInsertPoint(ThenBB);
 
-    Value *ThenV = ThenBlock.codeGen(context);
-    if (!ThenV) return nullptr;
+    // A block may yield no value, errors are told by the diagnostics
+    ThenBlock.codeGen(context);
+    if (!context.diagnostics.empty()) return nullptr;
 
     // Goto MergeBB when finish ThenBB
     context.Builder->CreateBr(MergeBB);
@@ -283,8 +459,8 @@ Value *NBranchStatement::codeGen(CodeGenContext &context) {
     TheFunction->insert(TheFunction->end(), ElseBB);
     context.Builder->SetInsertPoint(ElseBB);
 
-    Value *ElseV = ElseBlock->codeGen(context);
-    if (!ElseV) return nullptr;
+    ElseBlock->codeGen(context);
+    if (!context.diagnostics.empty()) return nullptr;
 
     // Goto MergeBB when finish ElseBB
     context.Builder->CreateBr(MergeBB);
@@ -294,19 +470,36 @@ Value *NBranchStatement::codeGen(CodeGenContext &context) {
   TheFunction->insert(TheFunction->end(), MergeBB);
   context.Builder->SetInsertPoint(MergeBB);
 
-  std::cout << "Created branch" << endl;
+  context.trace() << "Created branch\n";
 
   return nullptr;
 }
 
 
 llvm::Value *NWhileStatement::codeGen(CodeGenContext &context) {
-  std::cout << "Creating while" << endl;
+  context.trace() << "Creating while\n";
 
   Function *TheFunction = context.Builder->GetInsertBlock()->getParent();
-  BasicBlock *CondBB = BasicBlock::Create(MyContext, "whilecond");
-  BasicBlock *ThenBB = BasicBlock::Create(MyContext, "then");
-  BasicBlock *MergeBB = BasicBlock::Create(MyContext, "merge");
+  BasicBlock *CondBB = BasicBlock::Create(context.getContext(), "whilecond");
+  BasicBlock *ThenBB = BasicBlock::Create(context.getContext(), "then");
+  BasicBlock *MergeBB = BasicBlock::Create(context.getContext(), "merge");
+
+  // Count the trips in a slot of the entry block, so that nested loops
+  // don't grow the stack
+  Value *ProfileSite = nullptr;
+  AllocaInst *Trips = nullptr;
+  if (context.profile) {
+    ProfileSite = context.createProfileSite(
+        context.module->getName().str() + ":" + TheFunction->getName().str() +
+        ":" + std::to_string(line) + ":" + std::to_string(column));
+    IRBuilder<> EntryBuilder(&TheFunction->getEntryBlock(),
+                             TheFunction->getEntryBlock().begin());
+    Trips = EntryBuilder.CreateAlloca(Type::getInt64Ty(context.getContext()),
+                                      nullptr, "trips");
+    context.Builder->CreateStore(
+        ConstantInt::get(Type::getInt64Ty(context.getContext()), 0), Trips);
+    context.emitProfileCall("__toy_profile_loop_enter", ProfileSite);
+  }
 
   context.Builder->CreateBr(CondBB);
   TheFunction->insert(TheFunction->end(), CondBB);
@@ -316,15 +509,26 @@ llvm::Value *NWhileStatement::codeGen(CodeGenContext &context) {
   if (!CondV) return nullptr;
 
   CondV = context.Builder->CreateICmpEQ(
-      CondV, ConstantInt::get(Type::getInt64Ty(MyContext), 0), "whilecond");
+      CondV, ConstantInt::get(Type::getInt64Ty(context.getContext()), 0),
+      "whilecond");
 
   context.Builder->CreateCondBr(CondV, MergeBB, ThenBB);
 
   TheFunction->insert(TheFunction->end(), ThenBB);
   context.Builder->SetInsertPoint(ThenBB);
 
-  Value *ThenV = ThenBlock.codeGen(context);
-  if (!ThenV) return nullptr;
+  if (Trips) {
+    Value *Count = context.Builder->CreateLoad(
+        Type::getInt64Ty(context.getContext()), Trips);
+    context.Builder->CreateStore(
+        context.Builder->CreateAdd(
+            Count, ConstantInt::get(Type::getInt64Ty(context.getContext()), 1)),
+        Trips);
+  }
+
+  // A block may yield no value, errors are told by the diagnostics
+  ThenBlock.codeGen(context);
+  if (!context.diagnostics.empty()) return nullptr;
 
   // Back to CondBB
   context.Builder->CreateBr(CondBB);
@@ -333,8 +537,16 @@ llvm::Value *NWhileStatement::codeGen(CodeGenContext &context) {
 
   // Insert extra instructions to where from MergeBB
   context.Builder->SetInsertPoint(MergeBB);
+
+  if (Trips) {
+    context.emitLocation(*this);
+    context.emitProfileCall(
+        "__toy_profile_loop_exit", ProfileSite,
+        context.Builder->CreateLoad(Type::getInt64Ty(context.getContext()),
+                                    Trips));
+  }
   
-  std::cout << "Created while" << endl;
+  context.trace() << "Created while\n";
 
   return nullptr;
 }
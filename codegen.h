@@ -1,12 +1,10 @@
 #include <llvm/Bitcode/BitcodeWriter.h>
-#include <llvm/ExecutionEngine/ExecutionEngine.h>
-#include <llvm/ExecutionEngine/GenericValue.h>
-#include <llvm/ExecutionEngine/MCJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
 #include <llvm/IR/CallingConv.h>
+#include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/IRBuilder.h>
-#include <llvm/IR/IRPrintingPasses.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/LegacyPassManager.h>
@@ -14,49 +12,98 @@
 #include <llvm/IR/Type.h>
 #include <llvm/Pass.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/raw_ostream.h>
+#include "interface.h"
+#include <functional>
+#include <memory>
 #include <stack>
+#include <string>
 #include <typeinfo>
+#include <vector>
 
 using namespace llvm;
 
 
 class NBlock;
-
-static LLVMContext MyContext;
-
-inline void printIR(Module *module) {
-  /* Print the bytecode in a human-readable format to see if our program compiled properly */
-  auto pass = createPrintModulePass(outs());
-  pass->runOnModule(*module);
-}
+class Node;
 
 class CodeGenBlock {
   public:
   BasicBlock *block;
   Value *returnValue;
+  DIScope *debugScope; /* the function being generated, with debug info */
   std::map<std::string, Value *> locals;
 };
 
 class CodeGenContext {
   std::stack<CodeGenBlock *> blocks;
   Function *mainFunction;
+  /* Every context owns its own LLVMContext so that several programs can be
+     compiled concurrently on different threads */
+  std::unique_ptr<LLVMContext> TheContext;
+  std::unique_ptr<Module> TheModule;
+  /* The trace goes here unless verbose. LLVM's nulls() is one buffered
+     stream for the whole process, other threads would write to it too */
+  raw_null_ostream nullStream;
 
   public:
   std::unique_ptr<IRBuilder<>> Builder;
   Module *module;
-  CodeGenContext() {
-    module = new Module("main", MyContext);
-    Builder = std::make_unique<IRBuilder<>>(MyContext);
+  /* Errors found while generating code, reported back to the caller */
+  std::vector<std::string> diagnostics;
+  /* Print a trace of the code generation to stdout */
+  bool verbose = false;
+  /* Compile a module for others to import: the top level statements are not
+     exported as `main' */
+  bool library = false;
+  /* Signatures of the exported functions, for the interface file */
+  std::vector<FunctionSignature> exports;
+  /* Returns the interface file of an imported module, or null */
+  std::function<std::unique_ptr<MemoryBuffer>(StringRef)> importResolver;
+  /* Instrument functions and loops for the profiler, see profiler.cpp */
+  bool profile = false;
+  /* Only created when emitDebugInfo() is called */
+  std::unique_ptr<DIBuilder> DBuilder;
+  DICompileUnit *compileUnit = nullptr;
+
+  CodeGenContext(StringRef moduleName = "main") {
+    TheContext = std::make_unique<LLVMContext>();
+    TheModule = std::make_unique<Module>(moduleName, *TheContext);
+    module = TheModule.get();
+    Builder = std::make_unique<IRBuilder<>>(*TheContext);
   }
 
-  void generateCode(NBlock &root, std::string bcFile);
-  GenericValue runCode();
+  LLVMContext &getContext() { return *TheContext; }
+  raw_ostream &trace() {
+    if (verbose) return outs();
+    return nullStream;
+  }
+  void error(const std::string &message) { diagnostics.push_back(message); }
+
+  /* Emit DWARF line tables for the source file, before generating code */
+  void emitDebugInfo(StringRef filename, StringRef directory);
+  DISubprogram *createDebugFunction(Function *function, int line);
+  /* Attach the location of `node' to the following instructions */
+  void emitLocation(const Node &node);
+  /* Site of a profiled region, passed to the profiler runtime hooks */
+  Value *createProfileSite(StringRef name);
+  void emitProfileCall(StringRef hook, Value *site, Value *trips = nullptr);
+
+  void generateCode(NBlock &root);
+  /* Hand the module over to a JIT. The context can't be used afterwards */
+  orc::ThreadSafeModule takeModule() {
+    DBuilder.reset();
+    Builder.reset();
+    module = nullptr;
+    return orc::ThreadSafeModule(std::move(TheModule), std::move(TheContext));
+  }
   std::map<std::string, Value *> &locals() { return blocks.top()->locals; }
   BasicBlock *currentBlock() { return blocks.top()->block; }
   void pushBlock(BasicBlock *block) {
     blocks.push(new CodeGenBlock());
     blocks.top()->returnValue = NULL;
+    blocks.top()->debugScope = NULL;
     blocks.top()->block = block;
   }
   void popBlock() {
@@ -68,6 +115,7 @@ class CodeGenContext {
     blocks.top()->returnValue = value;
   }
   Value *getCurrentReturnValue() { return blocks.top()->returnValue; }
+  void setDebugScope(DIScope *scope) { blocks.top()->debugScope = scope; }
 };
 
 void createCoreFunctions(CodeGenContext &context);
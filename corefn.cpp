@@ -4,11 +4,9 @@
 
 using namespace std;
 
-extern int yyparse();
-extern NBlock *programBlock;
-
 
 llvm::Function *createPrintfFunction(CodeGenContext &context) {
+  llvm::LLVMContext &MyContext = context.getContext();
   std::vector<llvm::Type *> printf_arg_types;
   printf_arg_types.push_back(llvm::Type::getInt8PtrTy(MyContext));//char*
 
@@ -23,6 +21,7 @@ llvm::Function *createPrintfFunction(CodeGenContext &context) {
 }
 
 void createEchoFunction(CodeGenContext &context, llvm::Function *printfFn) {
+  llvm::LLVMContext &MyContext = context.getContext();
   std::vector<llvm::Type *> echo_arg_types;
   echo_arg_types.push_back(llvm::Type::getInt64Ty(MyContext));
 
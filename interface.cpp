@@ -0,0 +1,130 @@
+#include "interface.h"
+#include <llvm/Support/LEB128.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+static const char Magic[] = {'T', 'O', 'Y', 'I'};
+static const uint8_t Version = 1;
+
+InterfaceType interfaceTypeOf(StringRef typeName) {
+  if (typeName == "int") return InterfaceType::Int;
+  if (typeName == "double") return InterfaceType::Double;
+  return InterfaceType::Void;
+}
+
+StringRef typeNameOf(InterfaceType type) {
+  switch (type) {
+    case InterfaceType::Int:
+      return "int";
+    case InterfaceType::Double:
+      return "double";
+    case InterfaceType::Void:
+      break;
+  }
+  return "void";
+}
+
+std::string writeInterface(const std::vector<FunctionSignature> &functions) {
+  std::string data;
+  raw_string_ostream OS(data);
+  OS.write(Magic, sizeof(Magic));
+  OS << (char) Version;
+  encodeULEB128(functions.size(), OS);
+  for (auto &function : functions) {
+    encodeULEB128(function.Name.size(), OS);
+    OS << function.Name;
+    OS << (char) function.ReturnType;
+    encodeULEB128(function.ArgTypes.size(), OS);
+    for (auto argType : function.ArgTypes) OS << (char) argType;
+  }
+  OS.flush();
+  return data;
+}
+
+/* Reads the interface front to back, failing on the first malformed field */
+class InterfaceReader {
+  const uint8_t *cur;
+  const uint8_t *end;
+
+  public:
+  std::string error;
+
+  InterfaceReader(StringRef data)
+      : cur(data.bytes_begin()), end(data.bytes_end()) {}
+
+  bool readULEB(uint64_t &value) {
+    unsigned n = 0;
+    const char *err = nullptr;
+    value = decodeULEB128(cur, &n, end, &err);
+    if (err) {
+      error = err;
+      return false;
+    }
+    cur += n;
+    return true;
+  }
+
+  bool readBytes(size_t size, StringRef &bytes) {
+    if (size > size_t(end - cur)) {
+      error = "unexpected end of interface";
+      return false;
+    }
+    bytes = StringRef((const char *) cur, size);
+    cur += size;
+    return true;
+  }
+
+  bool readType(InterfaceType &type) {
+    StringRef byte;
+    if (!readBytes(1, byte)) return false;
+    if ((uint8_t) byte[0] > (uint8_t) InterfaceType::Double) {
+      error = "unknown type in interface";
+      return false;
+    }
+    type = (InterfaceType) byte[0];
+    return true;
+  }
+};
+
+bool readInterface(StringRef data, std::vector<FunctionSignature> &functions,
+                   std::string &error) {
+  InterfaceReader reader(data);
+  StringRef header;
+  if (!reader.readBytes(sizeof(Magic) + 1, header) ||
+      header.take_front(sizeof(Magic)) != StringRef(Magic, sizeof(Magic))) {
+    error = "not an interface file";
+    return false;
+  }
+  if ((uint8_t) header.back() != Version) {
+    error = "unsupported interface version";
+    return false;
+  }
+
+  uint64_t count;
+  if (!reader.readULEB(count)) {
+    error = reader.error;
+    return false;
+  }
+  for (uint64_t i = 0; i < count; i++) {
+    FunctionSignature function;
+    uint64_t nameLength, argCount;
+    StringRef name;
+    if (!reader.readULEB(nameLength) || !reader.readBytes(nameLength, name) ||
+        !reader.readType(function.ReturnType) || !reader.readULEB(argCount)) {
+      error = reader.error;
+      return false;
+    }
+    function.Name = name.str();
+    for (uint64_t j = 0; j < argCount; j++) {
+      InterfaceType argType;
+      if (!reader.readType(argType)) {
+        error = reader.error;
+        return false;
+      }
+      function.ArgTypes.push_back(argType);
+    }
+    functions.push_back(std::move(function));
+  }
+  return true;
+}
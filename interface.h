@@ -0,0 +1,35 @@
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <string>
+#include <vector>
+
+/* Interface summaries of separately compiled modules.
+
+   Compiling a module also produces a small binary interface file holding the
+   signatures of the functions it exports. Programs that `import' the module
+   only load that file and declare the functions, instead of parsing and
+   generating code for the module source again.
+
+   Layout, all counts and lengths are ULEB128 encoded:
+     "TOYI" version
+     count { name-length name return-type arg-count { arg-type } }
+   where the types are one byte each, see InterfaceType. */
+
+enum class InterfaceType : uint8_t { Void = 0, Int = 1, Double = 2 };
+
+struct FunctionSignature {
+  std::string Name;
+  InterfaceType ReturnType;
+  std::vector<InterfaceType> ArgTypes;
+};
+
+/* Maps between the type names of the language and the interface types */
+InterfaceType interfaceTypeOf(llvm::StringRef typeName);
+llvm::StringRef typeNameOf(InterfaceType type);
+
+std::string writeInterface(const std::vector<FunctionSignature> &functions);
+/* Returns false and sets `error' if `data' isn't a valid interface */
+bool readInterface(llvm::StringRef data,
+                   std::vector<FunctionSignature> &functions,
+                   std::string &error);
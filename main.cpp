@@ -1,127 +1,197 @@
-#include "codegen.h"
-#include "node.h"
-#include "llvm/IR/LegacyPassManager.h"
-#include "llvm/MC/TargetRegistry.h"
+#include "toycompiler.h"
 #include "llvm/Support/FileSystem.h"
-#include "llvm/Support/Host.h"
-#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Target/TargetOptions.h"
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar.h"
-#include "llvm/Transforms/Scalar/GVN.h"
-#include <stdio.h>
+#include <cstdlib>
 #include <memory>
 #include <string>
+#include <vector>
 
 using namespace std;
 using namespace llvm;
-using namespace llvm::sys;
 
-extern FILE *yyin;
-extern int yyparse();
-extern NBlock *programBlock;
-
-int main(int argc, char **argv) {
-  const char *fname = "test/example.txt";
-  const char *foutname = "test/example.bc";
-  if (argc == 3) {
-    fname = argv[1];
-    foutname = argv[2];
-  }
+static bool writeFile(StringRef Filename, const MemoryBuffer &Buffer) {
+  std::error_code EC;
+  raw_fd_ostream dest(Filename, EC, sys::fs::OF_None);
 
-  FILE *fp = fopen(fname, "r");
-  if (!fp) {
-    errs() << "Failed when open file " << fname << '\n';
-    exit(-1);
-  }
-  yyin = fp;
-  int parseErr = yyparse();
-  if (parseErr != 0) {
-    errs() << "Failed when parse\n";
-    exit(-1);
+  if (EC) {
+    errs() << "Could not open file: " << EC.message();
+    return false;
   }
-  fclose(fp);
-
-  InitializeAllTargetInfos();
-  InitializeAllTargets();
-  InitializeAllTargetMCs();
-  InitializeAllAsmParsers();
-  InitializeAllAsmPrinters();
-
-  CodeGenContext context;
-  createCoreFunctions(context);
-  context.generateCode(*programBlock, foutname);
-
-  auto TargetTriple = sys::getDefaultTargetTriple();
-  auto TheModule = context.module;
-
-  // Create a new pass manager attached to it.
-  std::shared_ptr<legacy::FunctionPassManager> FPM =
-    std::make_shared<legacy::FunctionPassManager>(TheModule);
-
-  // Do simple "peephole" optimizations and bit-twiddling optzns.
-  FPM->add(createInstructionCombiningPass());
-  // Reassociate expressions.
-  FPM->add(createReassociatePass());
-  // Eliminate Common SubExpressions.
-  FPM->add(createGVNPass());
-  // Simplify the control flow graph (deleting unreachable blocks, etc).
-  FPM->add(createCFGSimplificationPass());
-
-  FPM->doInitialization();
-
-  // Optimize with function passes
-  for (auto &Func: *TheModule) FPM->run(Func);
-
-  printIR(TheModule);
-
-  TheModule->setTargetTriple(TargetTriple);
 
-  std::string Error;
-  auto Target = TargetRegistry::lookupTarget(TargetTriple, Error);
+  dest << Buffer.getBuffer();
+  dest.flush();
+  return true;
+}
 
-  // Print an error and exit if we couldn't find the requested target.
-  // This generally occurs if we've forgotten to initialise the
-  // TargetRegistry or we have a bogus target triple.
-  if (!Target) {
-    errs() << Error;
-    return 1;
+/* Runs the ThinLTO backends over `Inputs', writing `Output'.N.o files */
+static int linkThinLTOFiles(StringRef Output, ArrayRef<const char *> Inputs,
+                            const LinkOptions &Options) {
+  std::vector<std::unique_ptr<MemoryBuffer>> Buffers;
+  std::vector<MemoryBufferRef> Refs;
+  for (auto Input : Inputs) {
+    auto Buffer = MemoryBuffer::getFile(Input);
+    if (!Buffer) {
+      errs() << "Failed when open file " << Input << '\n';
+      return 1;
+    }
+    Refs.push_back((*Buffer)->getMemBufferRef());
+    Buffers.push_back(std::move(*Buffer));
   }
 
-  auto CPU = "generic";
-  auto Features = "";
-
+  LinkResult Result = linkThinLTO(Refs, Options);
+  for (auto &Diagnostic : Result.Diagnostics)
+    errs() << "Error: " << Diagnostic << '\n';
+  if (!Result.Success) return 1;
 
-  TargetOptions opt;
-  auto RM = std::optional<Reloc::Model>();
-  auto TheTargetMachine =
-      Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
+  for (size_t i = 0; i < Result.Objects.size(); i++) {
+    std::string Filename = (Output + "." + Twine(i) + ".o").str();
+    if (!writeFile(Filename, *Result.Objects[i])) return 1;
+    outs() << "Wrote " << Filename << "\n";
+  }
+  return 0;
+}
 
-  TheModule->setDataLayout(TheTargetMachine->createDataLayout());
+/* Usage: compiler [-g] [--profile] [--library] [--thinlto] [--target triple]
+                   [-I dir]... [input output]
+          compiler [-g] [--profile] [-I dir]... --run input
+          compiler --thinlto-link [-j N] [--thinlto-cache dir] output inputs...
+   -g emits DWARF line tables, --run executes the program in memory,
+   --target emits code for another triple than the host,
+   --profile instruments functions and loops, the report is printed at exit,
+   --thinlto writes bitcode with a ThinLTO summary instead of an object,
+   --thinlto-link runs the ThinLTO backends over such bitcode files,
+   --startup-marker prints and flushes "started" once the driver is ready to
+   compile, for tools/startup-bench */
+int main(int argc, char **argv) {
+  const char *fname = "test/example.txt";
+  const char *Filename = "test/output.o";
+  bool Library = false;
+  bool ThinLTO = false;
+  bool ThinLTOLink = false;
+  bool DebugInfo = false;
+  bool Run = false;
+  bool Profile = false;
+  bool StartupMarker = false;
+  LinkOptions LinkOpts;
+  std::string TargetTriple;
+  std::vector<std::string> ImportDirs;
+  std::vector<const char *> Positional;
+  for (int i = 1; i < argc; i++) {
+    StringRef Arg = argv[i];
+    if (Arg == "--library")
+      Library = true;
+    else if (Arg == "-g")
+      DebugInfo = true;
+    else if (Arg == "--run")
+      Run = true;
+    else if (Arg == "--profile")
+      Profile = true;
+    else if (Arg == "--target" && i + 1 < argc)
+      TargetTriple = argv[++i];
+    else if (Arg == "--startup-marker")
+      StartupMarker = true;
+    else if (Arg == "--thinlto")
+      ThinLTO = true;
+    else if (Arg == "--thinlto-link")
+      ThinLTOLink = true;
+    else if (Arg == "--thinlto-cache" && i + 1 < argc)
+      LinkOpts.CacheDir = argv[++i];
+    else if (Arg == "-j" && i + 1 < argc)
+      LinkOpts.Threads = atoi(argv[++i]);
+    else if (Arg == "-I" && i + 1 < argc)
+      ImportDirs.push_back(argv[++i]);
+    else if (Arg.startswith("-I"))
+      ImportDirs.push_back(Arg.drop_front(2).str());
+    else
+      Positional.push_back(argv[i]);
+  }
 
-  auto Filename = "test/output.o";
-  if (argc == 3) Filename = argv[2];
-  std::error_code EC;
-  raw_fd_ostream dest(Filename, EC, sys::fs::OF_None);
+  if (ThinLTOLink) {
+    if (Positional.size() < 2) {
+      errs() << "--thinlto-link needs an output and some inputs\n";
+      return 1;
+    }
+    return linkThinLTOFiles(Positional[0],
+                            ArrayRef(Positional).drop_front(), LinkOpts);
+  }
 
-  if (EC) {
-    errs() << "Could not open file: " << EC.message();
-    return 1;
+  if (Run && Positional.size() == 1) {
+    fname = Positional[0];
+  } else if (Positional.size() == 2) {
+    fname = Positional[0];
+    Filename = Positional[1];
   }
+  /* Imports are looked up next to the importing source first */
+  ImportDirs.insert(ImportDirs.begin(), sys::path::parent_path(fname).str());
 
-  legacy::PassManager pass;
-  auto FileType = CGFT_ObjectFile;
+  auto Source = MemoryBuffer::getFile(fname);
+  if (!Source) {
+    errs() << "Failed when open file " << fname << '\n';
+    exit(-1);
+  }
 
-  if (TheTargetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType)) {
-    errs() << "TheTargetMachine can't emit a file of this type";
-    return 1;
+  /* stdout is block buffered in a pipe, flush so the benchmark sees it now.
+     Targets are set up later, by the compile that needs them */
+  if (StartupMarker) {
+    outs() << "started\n";
+    outs().flush();
   }
 
-  pass.run(*TheModule);
-  dest.flush();
+  CompileOptions Options;
+  Options.ModuleName = sys::path::stem(fname).str();
+  Options.SourceFile = fname;
+  Options.DebugInfo = DebugInfo;
+  Options.Profile = Profile;
+  Options.TargetTriple = TargetTriple;
+  Options.EmitIR = true;
+  Options.Verbose = true;
+  Options.Library = Library;
+  if (ThinLTO) Options.Output = CompileOutput::ThinLTO;
+  if (Run) Options.Output = CompileOutput::JIT;
+  Options.ImportResolver =
+      [&ImportDirs](StringRef Name) -> std::unique_ptr<MemoryBuffer> {
+    for (auto &Dir : ImportDirs) {
+      SmallString<128> Path(Dir);
+      sys::path::append(Path, Name + ".toyi");
+      if (auto Interface = MemoryBuffer::getFile(Path))
+        return std::move(*Interface);
+    }
+    return nullptr;
+  };
+  CompileResult Result = compileProgram((*Source)->getBuffer(), Options);
+
+  for (auto &Diagnostic : Result.Diagnostics)
+    errs() << "Error: " << Diagnostic << '\n';
+  if (!Result.Success) return 1;
+
+  outs() << Result.IR;
+
+  if (Run) {
+    auto ExitCode = runJITModule(std::move(*Result.JITModule));
+    if (!ExitCode) {
+      errs() << "Error: " << toString(ExitCode.takeError()) << '\n';
+      return 1;
+    }
+    return *ExitCode;
+  }
 
+  if (!writeFile(Filename, *Result.Object)) return 1;
   outs() << "Wrote " << Filename << "\n";
 
+  /* The interface of the module goes next to its object. It is left alone
+     when unchanged, so that the importers aren't rebuilt */
+  if (Result.Interface) {
+    SmallString<128> InterfaceFilename(Filename);
+    sys::path::replace_extension(InterfaceFilename, "toyi");
+    auto Existing = MemoryBuffer::getFile(InterfaceFilename);
+    if (!Existing ||
+        (*Existing)->getBuffer() != Result.Interface->getBuffer()) {
+      if (!writeFile(InterfaceFilename, *Result.Interface)) return 1;
+      outs() << "Wrote " << InterfaceFilename << "\n";
+    }
+  }
+
   return 0;
 }
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <iostream>
 #include <llvm/IR/Value.h>
 #include <vector>
@@ -16,6 +18,9 @@ using IFBlockList = std::vector<NBlock *>;
 
 class Node {
   public:
+  /* Source location, only set on statements */
+  int line = 0;
+  int column = 0;
   virtual ~Node() {}
   virtual llvm::Value *codeGen(CodeGenContext &context) { return NULL; }
 };
@@ -168,8 +173,16 @@ class NFunctionDeclaration : public NStatement {
   const NIdentifier &id;
   VariableList arguments;
   NBlock &block;
+  bool exported = false; /* visible to modules importing this one */
   NFunctionDeclaration(const NIdentifier &type, const NIdentifier &id,
                        const VariableList &arguments, NBlock &block)
       : type(type), id(id), arguments(arguments), block(block) {}
   virtual llvm::Value *codeGen(CodeGenContext &context);
 };
+
+class NImportStatement : public NStatement {
+  public:
+  const NIdentifier &module;
+  NImportStatement(const NIdentifier &module) : module(module) {}
+  virtual llvm::Value *codeGen(CodeGenContext &context);
+};
@@ -1,13 +1,49 @@
-%{
+%code requires {
         #include "node.h"
+        #include <memory>
+        #include <string>
+        #include <vector>
+
+        /* Everything a single parse produces. The scanner and the parser are
+           reentrant, so several programs can be parsed at the same time */
+        struct ParserState {
+                NBlock *programBlock = nullptr; /* the top level root node of our final AST */
+                std::vector<std::string> errors;
+                /* Owns every node of the AST, of a failed parse too. The AST
+                   is freed with the state */
+                std::vector<std::unique_ptr<Node>> nodes;
+
+                template <typename T, typename... Args> T *make(Args &&...args) {
+                        T *node = new T(std::forward<Args>(args)...);
+                        nodes.emplace_back(node);
+                        return node;
+                }
+        };
+}
+
+%{
         #include <cstdio>
         #include <cstdlib>
-        NBlock *programBlock; /* the top level root node of our final AST */
-
-        extern int yylex();
-        void yyerror(const char *s) { std::printf("Error: %s\n", s);std::exit(1); }
 %}
 
+%code {
+        int yylex(YYSTYPE *lvalp, YYLTYPE *llocp, void *scanner);
+        void yyerror(YYLTYPE *llocp, void *scanner, ParserState *state, const char *s) {
+                state->errors.push_back("line " + std::to_string(llocp->first_line) + ": " + s);
+        }
+
+        /* Statements remember where they start, for the debug line tables */
+        static void setLocation(Node *node, const YYLTYPE &loc) {
+                node->line = loc.first_line;
+                node->column = loc.first_column;
+        }
+}
+
+%define api.pure full
+%locations
+%lex-param {void *scanner}
+%parse-param {void *scanner} {ParserState *state}
+
 /* Represents the many different ways we can access our data */
 %union {
         Node *node;
@@ -22,6 +58,10 @@
         int token;
 }
 
+/* The nodes belong to the ParserState, only the strings and the lists are
+   left to free when a syntax error discards them */
+%destructor { delete $$; } <string> <varvec> <exprvec>
+
 /* Define our terminal symbols (tokens). This should
    match our tokens.l lex file. We also define the node type
    they represent.
@@ -30,7 +70,7 @@
 %token <token> TCEQ TCNE TCLT TCLE TCGT TCGE TEQUAL
 %token <token> TLPAREN TRPAREN TLBRACE TRBRACE TCOMMA TDOT
 %token <token> TPLUS TMINUS TMUL TDIV
-%token <token> TRETURN TEXTERN TIF TELSE TWHILE
+%token <token> TRETURN TEXTERN TIF TELSE TWHILE TIMPORT TEXPORT
 
 /* Define the type of node our nonterminal symbols represent.
    The types refer to the %union declaration above. Ex: when
@@ -42,7 +82,7 @@
 %type <varvec> func_decl_args
 %type <exprvec> call_args
 %type <block> program stmts block else_block if_block if_blocks
-%type <stmt> stmt var_decl func_decl extern_decl
+%type <stmt> stmt var_decl func_decl extern_decl import_decl
 %type <token> comparison calculation
 
 /* Operator precedence for mathematical operators */
@@ -61,51 +101,58 @@
 
 %%
 
-program : stmts { programBlock = $1; }
+program : stmts { state->programBlock = $1; }
          ;
 
-stmts : stmt { $$ = new NBlock(); $$->statements.push_back($<stmt>1); }
-         | stmts stmt { $1->statements.push_back($<stmt>2); }
+stmts : stmt { $$ = state->make<NBlock>(); setLocation($1, @1); $$->statements.push_back($<stmt>1); }
+         | stmts stmt { setLocation($2, @2); $1->statements.push_back($<stmt>2); }
          ;
 
 stmt : func_decl
          | var_decl
          | extern_decl
-         | call_expr { $$ = new NExpressionStatement(*$1); }
-         | assign_expr { $$ = new NExpressionStatement(*$1); }
-         | TRETURN call_expr { $$ = new NReturnStatement(*$2); }
-         | TRETURN value_expr { $$ = new NReturnStatement(*$2); }
-         | if_blocks else_block { $$ = new NBranchStatement(((NIFBlocks *)$1)->getIFBlocks(), $2); }
-         | TWHILE TLPAREN expr TRPAREN block { $$ = new NWhileStatement(*$3, *$5); }
+         | import_decl
+         | call_expr { $$ = state->make<NExpressionStatement>(*$1); }
+         | assign_expr { $$ = state->make<NExpressionStatement>(*$1); }
+         | TRETURN call_expr { $$ = state->make<NReturnStatement>(*$2); }
+         | TRETURN value_expr { $$ = state->make<NReturnStatement>(*$2); }
+         | if_blocks else_block { $$ = state->make<NBranchStatement>(((NIFBlocks *)$1)->getIFBlocks(), $2); }
+         | TWHILE TLPAREN expr TRPAREN block { $$ = state->make<NWhileStatement>(*$3, *$5); }
          ;
 
 expr : value_expr { $$ = $1; }
 
-if_blocks: if_block { $$ = new NIFBlocks(); ((NIFBlocks *)$$)->IFBlocks.push_back($1); }
+if_blocks: if_block { $$ = state->make<NIFBlocks>(); ((NIFBlocks *)$$)->IFBlocks.push_back($1); }
          | if_blocks TELSE if_block { ((NIFBlocks *)$1)->IFBlocks.push_back($3); }
          ;
 
-if_block : TIF TLPAREN expr TRPAREN block { $$ = new NIFBlock(*$3, *$5); }
+if_block : TIF TLPAREN expr TRPAREN block { $$ = state->make<NIFBlock>(*$3, *$5); }
 
 else_block: /*blank*/ { $$ = nullptr; }
          | TELSE block { $$ = $2; }
          ;
 
 block : TLBRACE stmts TRBRACE { $$ = $2; }
-         | TLBRACE TRBRACE { $$ = new NBlock(); }
+         | TLBRACE TRBRACE { $$ = state->make<NBlock>(); }
          ;
 
-var_decl : ident ident { $$ = new NVariableDeclaration(*$1, *$2); }
-         | ident ident TEQUAL call_expr { $$ = new NVariableDeclaration(*$1, *$2, $4); }
-         | ident ident TEQUAL value_expr { $$ = new NVariableDeclaration(*$1, *$2, $4); }
+var_decl : ident ident { $$ = state->make<NVariableDeclaration>(*$1, *$2); }
+         | ident ident TEQUAL call_expr { $$ = state->make<NVariableDeclaration>(*$1, *$2, $4); }
+         | ident ident TEQUAL value_expr { $$ = state->make<NVariableDeclaration>(*$1, *$2, $4); }
          ;
 
 extern_decl : TEXTERN ident ident TLPAREN func_decl_args TRPAREN
-                { $$ = new NExternDeclaration(*$2, *$3, *$5); delete $5; }
+                { $$ = state->make<NExternDeclaration>(*$2, *$3, *$5); delete $5; }
          ;
 
 func_decl : ident ident TLPAREN func_decl_args TRPAREN block
-                        { $$ = new NFunctionDeclaration(*$1, *$2, *$4, *$6); delete $4; }
+                        { $$ = state->make<NFunctionDeclaration>(*$1, *$2, *$4, *$6); delete $4; }
+         | TEXPORT ident ident TLPAREN func_decl_args TRPAREN block
+                        { auto func = state->make<NFunctionDeclaration>(*$2, *$3, *$5, *$7); delete $5;
+                          func->exported = true; $$ = func; }
+         ;
+
+import_decl : TIMPORT ident { $$ = state->make<NImportStatement>(*$2); }
          ;
 
 func_decl_args : /*blank*/  { $$ = new VariableList(); }
@@ -113,18 +160,18 @@ func_decl_args : /*blank*/  { $$ = new VariableList(); }
          | func_decl_args TCOMMA var_decl { $1->push_back($<var_decl>3); }
          ;
 
-ident : TIDENTIFIER { $$ = new NIdentifier(*$1); delete $1; }
+ident : TIDENTIFIER { $$ = state->make<NIdentifier>(*$1); delete $1; }
          ;
 
-numeric : TINTEGER { $$ = new NInteger(atol($1->c_str())); delete $1; }
-         | TDOUBLE { $$ = new NDouble(atof($1->c_str())); delete $1; }
+numeric : TINTEGER { $$ = state->make<NInteger>(atol($1->c_str())); delete $1; }
+         | TDOUBLE { $$ = state->make<NDouble>(atof($1->c_str())); delete $1; }
          ;
 
-assign_expr : ident TEQUAL call_expr { $$ = new NAssignment(*$<ident>1, *$3); }
-         | ident TEQUAL value_expr { $$ = new NAssignment(*$<ident>1, *$3); }
+assign_expr : ident TEQUAL call_expr { $$ = state->make<NAssignment>(*$<ident>1, *$3); }
+         | ident TEQUAL value_expr { $$ = state->make<NAssignment>(*$<ident>1, *$3); }
          ;
 
-call_expr : ident TLPAREN call_args TRPAREN { $$ = new NMethodCall(*$1, *$3); delete $3; }
+call_expr : ident TLPAREN call_args TRPAREN { $$ = state->make<NMethodCall>(*$1, *$3); delete $3; }
          ;
 
 operand_expr: call_expr %prec TMUL
@@ -134,8 +181,8 @@ operand_expr: call_expr %prec TMUL
 value_expr: ident { $<ident>$ = $1; }
          | numeric
          | TLPAREN value_expr TRPAREN { $$ = $2; }
-         | operand_expr calculation operand_expr %prec TMUL { $$ = new NBinaryOperator(*$1, $2, *$3); }
-         | operand_expr comparison operand_expr %prec TCEQ { $$ = new NBinaryOperator(*$1, $2, *$3); }
+         | operand_expr calculation operand_expr %prec TMUL { $$ = state->make<NBinaryOperator>(*$1, $2, *$3); }
+         | operand_expr comparison operand_expr %prec TCEQ { $$ = state->make<NBinaryOperator>(*$1, $2, *$3); }
          ;
 
 call_args : /*blank*/  { $$ = new ExpressionList(); }
@@ -0,0 +1,164 @@
+/* Runtime of the --profile mode.
+
+   Programs compiled with --profile call the hooks below on entry and exit of
+   every function and `while' loop. The compiler emits a ProfileSite for each
+   of them, which gets an id on its first entry; from then on a hook only
+   indexes the counters of its thread with that id. Each thread keeps its own
+   counters and a stack of the active regions, so the hooks never take a lock
+   after the first entry of a site. When a thread ends its counters are
+   merged into the process totals, which are printed when the process exits,
+   to the file named by $TOY_PROFILE or to stderr.
+
+   The report is tab separated, sorted by exclusive time:
+     kind  name  calls  trips  inclusive  exclusive
+   Functions are named module:function, loops module:function:line:column.
+   Times are in cycles of the cycle counter. Exclusive time excludes the
+   nested function calls and loops. Recursive calls count their time more
+   than once in the inclusive time. */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* Layout of the { ptr, i32 } globals the compiler emits, see
+   CodeGenContext::createProfileSite() */
+struct ProfileSite {
+  const char *name;
+  uint32_t id; /* 0 until the site is first entered */
+};
+
+struct SiteInfo {
+  /* Copied, the code that passed it may be unloaded before the report */
+  std::string name;
+  bool loop;
+};
+
+struct SiteStats {
+  uint64_t calls = 0;
+  uint64_t trips = 0;
+  uint64_t inclusive = 0;
+  uint64_t exclusive = 0;
+
+  void add(const SiteStats &other) {
+    calls += other.calls;
+    trips += other.trips;
+    inclusive += other.inclusive;
+    exclusive += other.exclusive;
+  }
+};
+
+class ProfileRegistry {
+  std::mutex lock;
+  /* Indexed by site id - 1 */
+  std::vector<SiteInfo> sites;
+  /* Keyed by kind and name, so that the sites of a module that is loaded
+     again add up */
+  std::map<std::pair<bool, std::string>, SiteStats> totals;
+
+  public:
+  uint32_t registerSite(ProfileSite *site, bool loop) {
+    std::lock_guard<std::mutex> guard(lock);
+    uint32_t id = __atomic_load_n(&site->id, __ATOMIC_ACQUIRE);
+    if (id) return id; /* another thread was first */
+    sites.push_back({site->name, loop});
+    id = sites.size();
+    __atomic_store_n(&site->id, id, __ATOMIC_RELEASE);
+    return id;
+  }
+
+  void merge(const std::vector<SiteStats> &stats) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; i < stats.size(); i++)
+      if (stats[i].calls)
+        totals[{sites[i].loop, sites[i].name}].add(stats[i]);
+  }
+
+  void report() {
+    if (totals.empty()) return;
+    FILE *out = stderr;
+    if (const char *path = getenv("TOY_PROFILE"))
+      if (!(out = fopen(path, "w"))) out = stderr;
+
+    std::vector<std::pair<std::pair<bool, std::string>, SiteStats>> sorted(
+        totals.begin(), totals.end());
+    std::stable_sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+      return a.second.exclusive > b.second.exclusive;
+    });
+
+    fprintf(out, "kind\tname\tcalls\ttrips\tinclusive\texclusive\n");
+    for (auto &[key, stats] : sorted)
+      fprintf(out, "%s\t%s\t%llu\t%llu\t%llu\t%llu\n",
+              key.first ? "loop" : "function", key.second.c_str(),
+              (unsigned long long) stats.calls,
+              (unsigned long long) stats.trips,
+              (unsigned long long) stats.inclusive,
+              (unsigned long long) stats.exclusive);
+    if (out != stderr) fclose(out);
+  }
+
+  ~ProfileRegistry() { report(); }
+};
+
+static ProfileRegistry &registry() {
+  static ProfileRegistry registry;
+  return registry;
+}
+
+struct ProfileFrame {
+  uint32_t site; /* index into ThreadProfile::sites */
+  uint64_t start;
+  uint64_t nested; /* cycles spent in nested regions */
+};
+
+struct ThreadProfile {
+  /* Indexed by site id - 1 */
+  std::vector<SiteStats> sites;
+  std::vector<ProfileFrame> stack;
+
+  /* Create the registry first so it outlives the profiles */
+  ThreadProfile() { registry(); }
+  ~ThreadProfile() { registry().merge(sites); }
+
+  void enter(ProfileSite *site, bool loop) {
+    uint32_t id = __atomic_load_n(&site->id, __ATOMIC_ACQUIRE);
+    if (!id) id = registry().registerSite(site, loop);
+    if (id > sites.size()) sites.resize(id);
+    sites[id - 1].calls++;
+    stack.push_back({id - 1, __builtin_readcyclecounter(), 0});
+  }
+
+  void exit(uint64_t trips) {
+    uint64_t now = __builtin_readcyclecounter();
+    if (stack.empty()) return;
+    ProfileFrame frame = stack.back();
+    stack.pop_back();
+
+    uint64_t elapsed = now - frame.start;
+    SiteStats &site = sites[frame.site];
+    site.trips += trips;
+    site.inclusive += elapsed;
+    site.exclusive += elapsed - frame.nested;
+    if (!stack.empty()) stack.back().nested += elapsed;
+  }
+};
+
+static thread_local ThreadProfile profile;
+
+extern "C" void __toy_profile_enter(ProfileSite *site) {
+  profile.enter(site, false);
+}
+
+extern "C" void __toy_profile_exit(ProfileSite *site) { profile.exit(0); }
+
+extern "C" void __toy_profile_loop_enter(ProfileSite *site) {
+  profile.enter(site, true);
+}
+
+extern "C" void __toy_profile_loop_exit(ProfileSite *site, long long trips) {
+  profile.exit(trips);
+}
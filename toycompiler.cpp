@@ -0,0 +1,403 @@
+#include "toycompiler.h"
+#include "codegen.h"
+#include "node.h"
+#include "parser.hpp"
+#include "tokens.hpp"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/LTO/LTO.h"
+#include "llvm/Support/Caching.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include <mutex>
+
+using namespace std;
+using namespace llvm;
+
+/* The runtime of the language, see native.cpp and profiler.cpp */
+extern "C" void printi(long long val);
+struct ProfileSite;
+extern "C" void __toy_profile_enter(ProfileSite *site);
+extern "C" void __toy_profile_exit(ProfileSite *site);
+extern "C" void __toy_profile_loop_enter(ProfileSite *site);
+extern "C" void __toy_profile_loop_exit(ProfileSite *site, long long trips);
+
+/* Parse the source text into an AST, collecting syntax errors in `state' */
+static void parseProgram(StringRef source, ParserState &state) {
+  yyscan_t scanner;
+  if (yylex_init_extra(&state, &scanner) != 0) {
+    state.errors.push_back("failed to create the scanner");
+    return;
+  }
+  yy_scan_bytes(source.data(), source.size(), scanner);
+  // The location lives in the buffer, which yy_scan_bytes leaves unset
+  yyset_lineno(1, scanner);
+  yyset_column(0, scanner);
+  int parseErr = yyparse(scanner, &state);
+  yylex_destroy(scanner);
+
+  if (parseErr != 0 && state.errors.empty())
+    state.errors.push_back("failed to parse the program");
+}
+
+/* The target registry is global, register the targets only once. Nothing is
+   registered until a compile actually needs a target, and then only the host
+   target, so startup stays cheap */
+static void initializeNativeTarget() {
+  static std::once_flag initialized;
+  std::call_once(initialized, [] {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+  });
+}
+
+/* Registers the targets needed to emit code for `triple' */
+static bool initializeTargetFor(const Triple &triple, std::string &Error) {
+  initializeNativeTarget();
+  if (triple.getArch() == Triple(sys::getProcessTriple()).getArch())
+    return true;
+#ifdef TOY_ALL_TARGETS
+  static std::once_flag initialized;
+  std::call_once(initialized, [] {
+    InitializeAllTargetInfos();
+    InitializeAllTargets();
+    InitializeAllTargetMCs();
+    InitializeAllAsmPrinters();
+  });
+  return true;
+#else
+  Error = "cannot target " + triple.str() +
+          ", only the host target is built in (see TOY_ALL_TARGETS)";
+  return false;
+#endif
+}
+
+static void optimizeModule(Module &module) {
+  // Create a new pass manager attached to it.
+  legacy::FunctionPassManager FPM(&module);
+
+  // Do simple "peephole" optimizations and bit-twiddling optzns.
+  FPM.add(createInstructionCombiningPass());
+  // Reassociate expressions.
+  FPM.add(createReassociatePass());
+  // Eliminate Common SubExpressions.
+  FPM.add(createGVNPass());
+  // Simplify the control flow graph (deleting unreachable blocks, etc).
+  FPM.add(createCFGSimplificationPass());
+
+  FPM.doInitialization();
+
+  // Optimize with function passes
+  for (auto &Func : module) FPM.run(Func);
+
+  FPM.doFinalization();
+}
+
+CompileResult compileProgram(StringRef Source, const CompileOptions &Options) {
+  CompileResult Result;
+
+  // Owns the AST, which is freed on every return below
+  ParserState state;
+  parseProgram(Source, state);
+  if (!state.errors.empty()) {
+    Result.Diagnostics = std::move(state.errors);
+    return Result;
+  }
+
+  CodeGenContext context(Options.ModuleName);
+  context.verbose = Options.Verbose;
+  context.library = Options.Library;
+  context.importResolver = Options.ImportResolver;
+  context.profile = Options.Profile;
+  if (Options.DebugInfo)
+    context.emitDebugInfo(sys::path::filename(Options.SourceFile),
+                          sys::path::parent_path(Options.SourceFile));
+  createCoreFunctions(context);
+  context.generateCode(*state.programBlock);
+  if (!context.diagnostics.empty()) {
+    Result.Diagnostics = std::move(context.diagnostics);
+    return Result;
+  }
+
+  auto TheModule = context.module;
+  // Catch what code generation let through before a pass or the backend
+  // trips over it
+  std::string VerifierErrors;
+  raw_string_ostream VerifierOS(VerifierErrors);
+  if (verifyModule(*TheModule, &VerifierOS)) {
+    Result.Diagnostics.push_back("invalid module: " + VerifierOS.str());
+    return Result;
+  }
+
+  if (Options.Library || !context.exports.empty())
+    Result.Interface = MemoryBuffer::getMemBufferCopy(
+        writeInterface(context.exports), Options.ModuleName + ".toyi");
+
+  if (Options.Optimize) optimizeModule(*TheModule);
+
+  if (Options.EmitIR) {
+    raw_string_ostream OS(Result.IR);
+    TheModule->print(OS, nullptr);
+  }
+
+  auto TargetTriple = Options.TargetTriple.empty()
+                          ? sys::getDefaultTargetTriple()
+                          : Triple::normalize(Options.TargetTriple);
+
+  std::string Error;
+  if (!initializeTargetFor(Triple(TargetTriple), Error)) {
+    Result.Diagnostics.push_back(Error);
+    return Result;
+  }
+  auto Target = TargetRegistry::lookupTarget(TargetTriple, Error);
+
+  // This generally occurs if we've forgotten to initialise the
+  // TargetRegistry or we have a bogus target triple.
+  if (!Target) {
+    Result.Diagnostics.push_back(Error);
+    return Result;
+  }
+
+  auto CPU = "generic";
+  auto Features = "";
+
+  TargetOptions opt;
+  auto RM = std::optional<Reloc::Model>();
+  std::unique_ptr<TargetMachine> TheTargetMachine(
+      Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM));
+
+  TheModule->setTargetTriple(TargetTriple);
+  TheModule->setDataLayout(TheTargetMachine->createDataLayout());
+
+  if (Options.Output == CompileOutput::JIT) {
+    Result.JITModule = context.takeModule();
+    Result.Success = true;
+    return Result;
+  }
+
+  SmallVector<char, 0> Buffer;
+  raw_svector_ostream dest(Buffer);
+
+  if (Options.Output == CompileOutput::ThinLTO) {
+    // The summary tells the thin link what each function references, so it
+    // can decide what to import without loading the other modules.
+    ProfileSummaryInfo PSI(*TheModule);
+    ModuleSummaryIndex Index =
+        buildModuleSummaryIndex(*TheModule, nullptr, &PSI);
+    // The module hash keys the backend cache of the linker.
+    WriteBitcodeToFile(*TheModule, dest, false, &Index, true);
+
+    Result.Object = MemoryBuffer::getMemBufferCopy(
+        StringRef(Buffer.data(), Buffer.size()), Options.ModuleName + ".bc");
+    Result.Success = true;
+    return Result;
+  }
+
+  legacy::PassManager pass;
+  auto FileType = CGFT_ObjectFile;
+
+  if (TheTargetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType)) {
+    Result.Diagnostics.push_back(
+        "TheTargetMachine can't emit a file of this type");
+    return Result;
+  }
+
+  pass.run(*TheModule);
+
+  Result.Object = MemoryBuffer::getMemBufferCopy(
+      StringRef(Buffer.data(), Buffer.size()), Options.ModuleName + ".o");
+  Result.Success = true;
+  return Result;
+}
+
+Expected<int> runJITModule(orc::ThreadSafeModule Module) {
+  initializeNativeTarget();
+
+  auto JIT =
+      orc::LLJITBuilder()
+          .setObjectLinkingLayerCreator([](orc::ExecutionSession &ES,
+                                           const Triple &TT) {
+            auto Layer = std::make_unique<orc::RTDyldObjectLinkingLayer>(
+                ES, [] { return std::make_unique<SectionMemoryManager>(); });
+            // Null unless LLVM was built with LLVM_USE_PERF
+            if (auto Listener = JITEventListener::createPerfJITEventListener())
+              Layer->registerJITEventListener(*Listener);
+            return Layer;
+          })
+          .create();
+  if (!JIT) return JIT.takeError();
+
+  // Resolve printf & co. from the process, and the runtime of the language
+  auto &MainJD = (*JIT)->getMainJITDylib();
+  auto Generator = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+      (*JIT)->getDataLayout().getGlobalPrefix());
+  if (!Generator) return Generator.takeError();
+  MainJD.addGenerator(std::move(*Generator));
+
+  orc::SymbolMap RuntimeSymbols;
+  auto AddRuntime = [&](StringRef Name, auto *Fn) {
+    RuntimeSymbols[(*JIT)->mangleAndIntern(Name)] = JITEvaluatedSymbol(
+        pointerToJITTargetAddress(Fn), JITSymbolFlags::Exported);
+  };
+  AddRuntime("printi", &printi);
+  AddRuntime("__toy_profile_enter", &__toy_profile_enter);
+  AddRuntime("__toy_profile_exit", &__toy_profile_exit);
+  AddRuntime("__toy_profile_loop_enter", &__toy_profile_loop_enter);
+  AddRuntime("__toy_profile_loop_exit", &__toy_profile_loop_exit);
+  if (Error E = MainJD.define(orc::absoluteSymbols(RuntimeSymbols)))
+    return std::move(E);
+
+  if (Error E = (*JIT)->addIRModule(std::move(Module))) return std::move(E);
+
+  auto Main = (*JIT)->lookup("main");
+  if (!Main) return Main.takeError();
+  return Main->toPtr<int()>()();
+}
+
+LinkResult linkThinLTO(ArrayRef<MemoryBufferRef> Inputs,
+                       const LinkOptions &Options) {
+  LinkResult Result;
+  std::mutex DiagnosticsMutex;
+
+  lto::Config Conf;
+  Conf.CPU = "generic";
+  Conf.DefaultTriple = sys::getDefaultTargetTriple();
+  // Called from the backend threads
+  Conf.DiagHandler = [&](const DiagnosticInfo &DI) {
+    if (DI.getSeverity() != DS_Error) return;
+    std::string Message;
+    raw_string_ostream OS(Message);
+    DiagnosticPrinterRawOStream DP(OS);
+    DI.print(DP);
+    std::lock_guard<std::mutex> Lock(DiagnosticsMutex);
+    Result.Diagnostics.push_back(OS.str());
+  };
+
+  lto::LTO Lto(std::move(Conf), lto::createInProcessThinBackend(
+                                    heavyweight_hardware_concurrency(
+                                        Options.Threads)));
+
+  std::vector<std::unique_ptr<lto::InputFile>> Files;
+  for (auto Input : Inputs) {
+    auto File = lto::InputFile::create(Input);
+    if (!File) {
+      Result.Diagnostics.push_back(toString(File.takeError()));
+      return Result;
+    }
+
+    std::string TargetError;
+    if (!initializeTargetFor(Triple((*File)->getTargetTriple()),
+                             TargetError)) {
+      Result.Diagnostics.push_back(TargetError);
+      return Result;
+    }
+    Files.push_back(std::move(*File));
+  }
+
+  // We are the whole link: a strong symbol may be defined only once, the
+  // first strong definition prevails over weak and linkonce ones, else the
+  // first of those. Only the exported symbols are seen by the native objects.
+  struct Definition {
+    size_t File;
+    bool Weak;
+  };
+  StringMap<Definition> Prevailing;
+  for (size_t i = 0; i < Files.size(); i++) {
+    for (const lto::InputFile::Symbol &Sym : Files[i]->symbols()) {
+      if (Sym.isUndefined()) continue;
+      auto [It, Inserted] =
+          Prevailing.try_emplace(Sym.getName(), Definition{i, Sym.isWeak()});
+      if (Inserted || Sym.isWeak()) continue;
+      if (!It->second.Weak) {
+        Result.Diagnostics.push_back(
+            "duplicate symbol " + Sym.getName().str() + " in " +
+            Inputs[It->second.File].getBufferIdentifier().str() + " and " +
+            Inputs[i].getBufferIdentifier().str());
+        continue;
+      }
+      It->second = Definition{i, false};
+    }
+  }
+  if (!Result.Diagnostics.empty()) return Result;
+
+  for (size_t i = 0; i < Files.size(); i++) {
+    std::vector<lto::SymbolResolution> Resolutions;
+    for (const lto::InputFile::Symbol &Sym : Files[i]->symbols()) {
+      lto::SymbolResolution R;
+      if (!Sym.isUndefined())
+        R.Prevailing = Prevailing.lookup(Sym.getName()).File == i;
+      R.FinalDefinitionInLinkageUnit = R.Prevailing;
+      R.VisibleToRegularObj = is_contained(Options.ExportedSymbols,
+                                           Sym.getName());
+      Resolutions.push_back(R);
+    }
+
+    if (Error E = Lto.add(std::move(Files[i]), Resolutions)) {
+      Result.Diagnostics.push_back(toString(std::move(E)));
+      return Result;
+    }
+  }
+
+  // Backend outputs land either in these buffers or, when they come from
+  // the cache, in CachedObjects.
+  unsigned MaxTasks = Lto.getMaxTasks();
+  std::vector<SmallVector<char, 0>> Buffers(MaxTasks);
+  std::vector<std::unique_ptr<MemoryBuffer>> CachedObjects(MaxTasks);
+
+  auto AddStream =
+      [&](size_t Task) -> Expected<std::unique_ptr<CachedFileStream>> {
+    return std::make_unique<CachedFileStream>(
+        std::make_unique<raw_svector_ostream>(Buffers[Task]));
+  };
+
+  FileCache Cache;
+  if (!Options.CacheDir.empty()) {
+    auto CacheOrErr = localCache(
+        "ThinLTO", "Thin", Options.CacheDir,
+        [&](size_t Task, std::unique_ptr<MemoryBuffer> MB) {
+          CachedObjects[Task] = std::move(MB);
+        });
+    if (!CacheOrErr) {
+      Result.Diagnostics.push_back(toString(CacheOrErr.takeError()));
+      return Result;
+    }
+    Cache = std::move(*CacheOrErr);
+  }
+
+  if (Error E = Lto.run(AddStream, Cache)) {
+    Result.Diagnostics.push_back(toString(std::move(E)));
+    return Result;
+  }
+  if (!Result.Diagnostics.empty()) return Result;
+
+  for (unsigned Task = 0; Task < MaxTasks; Task++) {
+    if (CachedObjects[Task]) {
+      Result.Objects.push_back(std::move(CachedObjects[Task]));
+    } else if (!Buffers[Task].empty()) {
+      Result.Objects.push_back(MemoryBuffer::getMemBufferCopy(
+          StringRef(Buffers[Task].data(), Buffers[Task].size()),
+          "thinlto." + std::to_string(Task) + ".o"));
+    }
+  }
+  Result.Success = true;
+  return Result;
+}
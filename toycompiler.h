@@ -0,0 +1,99 @@
+#pragma once
+
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Error.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+/* Embeddable entry point of the compiler. Everything below works on memory
+   only: no files are read or written and nothing is printed unless `Verbose'
+   is set. compileProgram() keeps no global state, so it may be called from
+   several threads at once. */
+
+enum class CompileOutput {
+  Object, /* emit a native object file into CompileResult::Object */
+  JIT,    /* hand the optimized module over in CompileResult::JITModule */
+  ThinLTO /* emit bitcode with a ThinLTO summary into CompileResult::Object,
+             to be linked with linkThinLTO() */
+};
+
+struct CompileOptions {
+  std::string ModuleName = "main";
+  /* Path of the source, only used to name it in the debug info */
+  std::string SourceFile = "main.txt";
+  CompileOutput Output = CompileOutput::Object;
+  /* Triple to emit code for, empty for the host. Other architectures need a
+     build with TOY_ALL_TARGETS */
+  std::string TargetTriple;
+  /* Run the function level optimizations (instcombine, reassociate, ...) */
+  bool Optimize = true;
+  /* Keep a textual copy of the final IR in CompileResult::IR */
+  bool EmitIR = false;
+  /* Trace the code generation to stdout, like the old compiler did */
+  bool Verbose = false;
+  /* Emit DWARF line tables, so profilers and debuggers can map the code
+     back to the source lines */
+  bool DebugInfo = false;
+  /* Instrument every function and `while' loop with calls into the profiler
+     runtime (profiler.cpp in the toyruntime library). Nothing is emitted
+     when it is off */
+  bool Profile = false;
+  /* Compile a module meant to be imported, see interface.h */
+  bool Library = false;
+  /* Looks up the interface file of an `import'ed module by name. The caller
+     decides where interfaces come from, return null if there is none */
+  std::function<std::unique_ptr<llvm::MemoryBuffer>(llvm::StringRef)>
+      ImportResolver;
+};
+
+struct CompileResult {
+  bool Success = false;
+  std::vector<std::string> Diagnostics;
+  std::string IR;
+  std::unique_ptr<llvm::MemoryBuffer> Object;
+  /* Interface file with the signatures of the exported functions, null
+     unless the module is a library or exports something */
+  std::unique_ptr<llvm::MemoryBuffer> Interface;
+  std::optional<llvm::orc::ThreadSafeModule> JITModule;
+};
+
+CompileResult compileProgram(llvm::StringRef Source,
+                             const CompileOptions &Options = CompileOptions());
+
+/* Runs `main' of a module compiled with CompileOutput::JIT and returns its
+   result. The jitted functions are reported to perf through a jitdump file
+   when LLVM is built with LLVM_USE_PERF */
+llvm::Expected<int> runJITModule(llvm::orc::ThreadSafeModule Module);
+
+struct LinkOptions {
+  /* Number of backend threads, 0 uses all the cores */
+  unsigned Threads = 0;
+  /* Directory to keep the backend outputs in, so that unchanged inputs
+     aren't compiled again. This is the only file access of the linker, an
+     empty directory disables the cache */
+  std::string CacheDir;
+  /* Symbols used from outside the linked bitcode, everything else is
+     internalized and dropped when unused */
+  std::vector<std::string> ExportedSymbols = {"main"};
+};
+
+struct LinkResult {
+  bool Success = false;
+  std::vector<std::string> Diagnostics;
+  /* One native object per backend task, to be handed to the system linker */
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> Objects;
+};
+
+/* Runs the ThinLTO backends over the bitcode of several modules compiled with
+   CompileOutput::ThinLTO. Small functions are imported and inlined across
+   modules, the backends run in parallel. Like any link it fails when two
+   inputs define the same strong symbol. The buffer identifiers of the
+   inputs must be unique, they name the modules */
+LinkResult linkThinLTO(llvm::ArrayRef<llvm::MemoryBufferRef> Inputs,
+                       const LinkOptions &Options = LinkOptions());